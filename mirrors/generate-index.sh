@@ -0,0 +1,52 @@
+#!/bin/sh
+# Generate the mirror index read by pkg from the mirror files.
+#
+# Usage: generate-index.sh <mirrors source dir> <mirror>...
+#
+# Every <mirror> is a path relative to the mirrors directory, like
+# "default" or "europe/grimler.se". One line is written per mirror:
+#
+#   <path> <region> <weight> <main url> <root url> <x11 url>
+#
+# where <region> is the directory of the mirror ("default" for the
+# default one) and urls that are not set are written as "-". The mirror
+# files stay the source of truth, pkg falls back to sourcing them when
+# the index is older than the files or lacks one of them.
+
+set -e
+
+srcdir="$1"
+shift
+
+check_url() {
+	case "$2" in
+		http://*|https://*) ;;
+		*) echo "Error: $mirror: invalid $1 url '$2'" >&2; exit 1;;
+	esac
+	case "$2" in
+		*[[:space:]]*) echo "Error: $mirror: invalid $1 url '$2'" >&2; exit 1;;
+	esac
+}
+
+for mirror in "$@"; do
+	unset MAIN ROOT X11 WEIGHT
+	. "$srcdir/$mirror"
+
+	if [ -z "${MAIN:-}" ]; then
+		echo "Error: $mirror: no main channel url" >&2
+		exit 1
+	fi
+	check_url main "$MAIN"
+	[ -z "${ROOT:-}" ] || check_url root "$ROOT"
+	[ -z "${X11:-}" ] || check_url x11 "$X11"
+	case "${WEIGHT:-}" in
+		''|*[!0-9]*) echo "Error: $mirror: invalid weight '${WEIGHT:-}'" >&2; exit 1;;
+	esac
+
+	case "$mirror" in
+		*/*) region="${mirror%%/*}";;
+		*) region=default;;
+	esac
+
+	echo "$mirror $region $WEIGHT $MAIN ${ROOT:--} ${X11:--}"
+done
@@ -5,30 +5,26 @@ get-mirror-description() {
         sed -n '4s/^# //p' "$mirror"
 }
 
-get-mirror-main-url() {
-	mirror="$1"
-	source "$mirror"
-	echo "$MAIN"
-}
-
-get-mirror-root-url() {
-	mirror="$1"
-	source "$mirror"
-	echo "$ROOT"
-}
-
-get-mirror-x11-url() {
-	mirror="$1"
-	source "$mirror"
-	echo "$X11"
+# Urls of all mirrors, parsed once by the generator of the index read by
+# pkg, which is parsed the same way by termux-mirror-probe on devices.
+declare -A mirror_main_urls=() mirror_root_urls=() mirror_x11_urls=()
+
+load-mirror-urls() {
+	local index mirror region weight main root x11
+	index="$(./generate-index.sh . $(git ls-files -- '*/*'))" || exit 1
+	while read -r mirror region weight main root x11; do
+		mirror_main_urls[$mirror]="$main"
+		mirror_root_urls[$mirror]="${root#-}"
+		mirror_x11_urls[$mirror]="${x11#-}"
+	done <<< "$index"
 }
 
 generate-mirror-table() {
 	mirror="$1"
 
-	main_entry='`deb '"$(get-mirror-main-url $mirror)"' stable main`'
-	root_entry='`deb '"$(get-mirror-root-url $mirror)"' root stable`'
-	x11_entry='`deb '"$(get-mirror-x11-url $mirror)"' x11 main`'
+	main_entry='`deb '"${mirror_main_urls[$mirror]}"' stable main`'
+	root_entry='`deb '"${mirror_root_urls[$mirror]}"' root stable`'
+	x11_entry='`deb '"${mirror_x11_urls[$mirror]}"' x11 main`'
 
 	# Calculate length of horizontal sep in sources.list entry column, to get a pretty table
 	len="${#main_entry}"
@@ -46,6 +42,8 @@ cd "$(realpath "$(dirname "$0")")"
 : "${TMPDIR:=/tmp}"
 export TMPDIR
 
+load-mirror-urls
+
 mirror_tmpfile="$(mktemp $TMPDIR/Mirrors.md.XXXXX)"
 cat ../wiki/mirrors_header.md > "$mirror_tmpfile"
 
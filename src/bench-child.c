@@ -0,0 +1,82 @@
+/* bench-child.c
+Copyright (C) 2025 Termux
+This file is part of termux-tools.
+termux-tools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+termux-tools is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with termux-tools.  If not, see
+<https://www.gnu.org/licenses/>.  */
+
+/* Stand-in for /system/bin/cmd used by the benchmark: consumes -i bytes
+   of stdin, then writes -o bytes to stdout and -e bytes to stderr in
+   interleaved chunks of -c bytes. -p text emits short lines like
+   `cmd package list packages` does instead of a zero-filled stream. */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+
+static char *buf;
+static size_t chunk = 64 * 1024;
+
+static void fill_text(void) {
+    static const char line[] = "package:/data/app/com.example.bench-1/base.apk=com.example.bench\n";
+    for (size_t i = 0; i < chunk; i++) buf[i] = line[i % (sizeof(line) - 1)];
+}
+
+static int emit(int fd, unsigned long long *left) {
+    size_t sz = *left < chunk ? *left : chunk;
+    while (sz) {
+        ssize_t t = write(fd, buf, sz);
+        if (t < 0 && errno == EINTR) continue;
+        if (t <= 0) return -1;
+        sz -= t;
+        *left -= t;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned long long out = 0, err_bytes = 0, in = 0;
+    int text = 0, opt;
+    while ((opt = getopt(argc, argv, "o:e:i:c:p:")) != -1) {
+        switch (opt) {
+        case 'o': out = strtoull(optarg, NULL, 10); break;
+        case 'e': err_bytes = strtoull(optarg, NULL, 10); break;
+        case 'i': in = strtoull(optarg, NULL, 10); break;
+        case 'c': chunk = strtoull(optarg, NULL, 10); break;
+        case 'p': text = strcmp(optarg, "text") == 0; break;
+        default:
+            fprintf(stderr, "Usage: %s [-o bytes] [-e bytes] [-i bytes] [-c chunk] [-p zero|text]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (chunk == 0) errx(EXIT_FAILURE, "chunk size must be positive");
+
+    buf = calloc(1, chunk);
+    if (buf == NULL) err(EXIT_FAILURE, "calloc");
+
+    while (in) {
+        ssize_t sz = read(STDIN_FILENO, buf, in < chunk ? in : chunk);
+        if (sz < 0 && errno == EINTR) continue;
+        if (sz <= 0) break;
+        in -= sz;
+    }
+    /* stdin was read into the same buffer. */
+    if (text) fill_text();
+
+    while (out || err_bytes) {
+        if (out && emit(STDOUT_FILENO, &out) == -1) return EXIT_FAILURE;
+        if (err_bytes && emit(STDERR_FILENO, &err_bytes) == -1) return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,166 @@
+/* bench.c
+Copyright (C) 2025 Termux
+This file is part of termux-tools.
+termux-tools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+termux-tools is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with termux-tools.  If not, see
+<https://www.gnu.org/licenses/>.  */
+
+/* Benchmark driver for the cmd relay, run through `make bench`.
+
+   Every scenario runs the stub child directly ("direct", the floor),
+   through the original thread-based relay ("threads") and through a build
+   of cmd that execs the stub, once per relay mode. Output of the wrapper
+   goes to a pipe drained by the driver, stdin is /dev/null or /dev/zero,
+   so stdin is always relayed while stdout and stderr are eligible for
+   pass-through. "copy-4k" is the poll() loop with the buffer and pipe
+   sizes of the original relay.
+
+   CPU time covers both the wrapper and the stub. */
+
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+struct scenario {
+    const char *name;
+    const char *input;
+    int runs;
+    unsigned long long bytes;
+    const char *args[8];
+};
+
+static const struct scenario scenarios[] = {
+    { "latency", "/dev/null", 200, 0, { "-o", "0" } },
+    { "text-4m", "/dev/null", 20, 4ULL << 20, { "-o", "4194304", "-p", "text", "-c", "4096" } },
+    { "stdout-64m", "/dev/null", 5, 64ULL << 20, { "-o", "67108864" } },
+    { "mixed-64m", "/dev/null", 5, 64ULL << 20, { "-o", "33554432", "-e", "33554432" } },
+    { "stdin-64m", "/dev/zero", 5, 64ULL << 20, { "-i", "67108864" } },
+};
+
+static const char *wrapper, *child, *threads;
+
+struct mode {
+    const char *name;
+    const char **program;
+    const char *env[5];
+};
+
+static const struct mode modes[] = {
+    { "direct", &child, { NULL } },
+    { "threads", &threads, { NULL } },
+    { "copy-4k", &wrapper, { "TERMUX_CMD_NO_PASSTHROUGH=1", "TERMUX_CMD_NO_SPLICE=1",
+                             "TERMUX_CMD_BUFFER_SIZE=4096", "TERMUX_CMD_PIPE_SIZE=65536" } },
+    { "copy", &wrapper, { "TERMUX_CMD_NO_PASSTHROUGH=1", "TERMUX_CMD_NO_SPLICE=1" } },
+    { "splice", &wrapper, { "TERMUX_CMD_NO_PASSTHROUGH=1" } },
+    { "default", &wrapper, { NULL } },
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_children(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_CHILDREN, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+           ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void run_once(const struct mode *m, const struct scenario *s) {
+    static char buf[1 << 20];
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) == -1) err(EXIT_FAILURE, "pipe");
+
+    pid_t pid = fork();
+    if (pid < 0) err(EXIT_FAILURE, "fork");
+    if (pid == 0) {
+        int in = open(s->input, O_RDONLY);
+        if (in == -1 || dup2(in, STDIN_FILENO) == -1) err(EXIT_FAILURE, "%s", s->input);
+        if (dup2(p[1], STDOUT_FILENO) == -1 || dup2(p[1], STDERR_FILENO) == -1) err(EXIT_FAILURE, "dup2");
+        for (int i = 0; m->env[i]; i++) putenv((char *)m->env[i]);
+
+        const char *argv[10] = { *m->program };
+        for (int i = 0; s->args[i]; i++) argv[i + 1] = s->args[i];
+        execv(argv[0], (char **)argv);
+        err(EXIT_FAILURE, "exec %s", argv[0]);
+    }
+
+    close(p[1]);
+    for (;;) {
+        ssize_t sz = read(p[0], buf, sizeof(buf));
+        if (sz < 0 && errno == EINTR) continue;
+        if (sz <= 0) break;
+    }
+    close(p[0]);
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1) err(EXIT_FAILURE, "wait");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        warnx("%s/%s: child failed with status %d", s->name, m->name, status);
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: cmd-bench-driver [-n runs-scale] -w wrapper -c child [-t threads]\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+    double scale = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:c:t:")) != -1) {
+        switch (opt) {
+        case 'n': scale = atof(optarg); break;
+        case 'w': wrapper = optarg; break;
+        case 'c': child = optarg; break;
+        case 't': threads = optarg; break;
+        default: usage();
+        }
+    }
+    if (wrapper == NULL || child == NULL || scale <= 0)
+        usage();
+
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%-12s %-8s %5s %10s %10s %12s\n", "scenario", "mode", "runs", "ms/call", "MB/s", "cpu ms/call");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        const struct scenario *s = &scenarios[i];
+        int runs = s->runs * scale < 1 ? 1 : s->runs * scale;
+        for (size_t j = 0; j < sizeof(modes) / sizeof(modes[0]); j++) {
+            const struct mode *m = &modes[j];
+            if (*m->program == NULL) continue;
+
+            double cpu = cpu_children(), start = now();
+            for (int r = 0; r < runs; r++) run_once(m, s);
+            double wall = now() - start;
+            cpu = cpu_children() - cpu;
+
+            char rate[32] = "-";
+            if (s->bytes) snprintf(rate, sizeof(rate), "%.1f", s->bytes * runs / wall / (1 << 20));
+            printf("%-12s %-8s %5d %10.3f %10s %12.3f\n", s->name, m->name, runs,
+                   wall * 1000 / runs, rate, cpu * 1000 / runs);
+            fflush(stdout);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
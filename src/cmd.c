@@ -13,15 +13,20 @@ You should have received a copy of the GNU General Public License
 along with termux-tools.  If not, see
 <https://www.gnu.org/licenses/>.  */
 
+#define _GNU_SOURCE
+
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <pthread.h>
+#include <poll.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 #ifndef TEMP_FAILURE_RETRY
@@ -35,38 +40,330 @@ along with termux-tools.  If not, see
   }))
 #endif
 
-void pump(int in_fd, int out_fd) {
-    char buf[4096];
-    ssize_t sz, t;
-    for (;;) {
-        sz = TEMP_FAILURE_RETRY(read(in_fd, buf, sizeof(buf)));
-        if (sz <= 0) return;
-        while (sz) {
-            t = TEMP_FAILURE_RETRY(write(out_fd, buf, sz));
-            if (t <= 0) return;
-            sz -= t;
+/* Overridden at build time by the benchmark, which runs against a stub
+   instead of /system/bin/cmd. */
+#ifndef CMD_PATH
+#define CMD_PATH "/system/bin/cmd"
+#endif
+
+/* Upper bound for a single splice() call. One of in_fd/out_fd is always
+   one of our pipes, so the kernel moves at most one pipe worth anyway. */
+#define SPLICE_CHUNK (1 << 20)
+
+/* The copy buffer starts small and doubles every time a read fills it,
+   and our pipes double every time a transfer finds them full, so bulk
+   output ends up with few large syscalls while short replies stay cheap.
+   TERMUX_CMD_BUFFER_SIZE and TERMUX_CMD_PIPE_SIZE pin either size. */
+#ifndef RELAY_BUFFER_MIN
+#define RELAY_BUFFER_MIN 4096
+#endif
+#ifndef RELAY_BUFFER_MAX
+#define RELAY_BUFFER_MAX (256 * 1024)
+#endif
+#ifndef RELAY_PIPE_MAX
+#define RELAY_PIPE_MAX (1024 * 1024)
+#endif
+
+static size_t buffer_size = RELAY_BUFFER_MIN, buffer_max = RELAY_BUFFER_MAX;
+static size_t pipe_size_max = RELAY_PIPE_MAX;
+static int pipe_size_pinned;
+
+/* Setting TERMUX_CMD_NO_SPLICE or TERMUX_CMD_NO_PASSTHROUGH turns off the
+   respective fast path, for debugging and for comparing them in the
+   benchmark. */
+static int no_splice, no_passthrough;
+
+/* TERMUX_CMD_STATS=path appends one JSON object per invocation to path,
+   telling how much of the call was spent in the wrapper. */
+static const char *stats_path;
+static long long start_us;
+
+static long long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* One direction of the relay between our stdio and the child's pipes.
+   Every fd of a relay is non-blocking, so that a slow reader of one
+   stream cannot stall the others; a write that does not fit waits for
+   POLLOUT instead. */
+struct relay {
+    int in_fd;
+    int out_fd;
+    int pipe_fd;      /* our pipe end, closed when the relay finishes */
+    int use_splice;   /* cleared once the kernel refuses splice() */
+    int out_blocked;  /* waiting for out_fd to become writable */
+    int done;
+    size_t pipe_size; /* capacity of our pipe, 0 once it may not grow */
+    size_t len, off, size;
+    char *buf;
+    unsigned long long bytes, syscalls;
+    long long first_byte_us;
+};
+
+static size_t parse_size(const char *name) {
+    const char *value = getenv(name);
+    if (value == NULL || *value == '\0') return 0;
+    char *end;
+    unsigned long size = strtoul(value, &end, 10);
+    if (*end != '\0' || size == 0) {
+        warnx("ignoring invalid %s: '%s'", name, value);
+        return 0;
+    }
+    return size;
+}
+
+static int env_set(const char *name) {
+    const char *value = getenv(name);
+    return value != NULL && *value != '\0';
+}
+
+static void relay_setup(void) {
+    no_splice = env_set("TERMUX_CMD_NO_SPLICE");
+    no_passthrough = env_set("TERMUX_CMD_NO_PASSTHROUGH");
+    size_t size = parse_size("TERMUX_CMD_BUFFER_SIZE");
+    if (size) buffer_size = buffer_max = size;
+    size = parse_size("TERMUX_CMD_PIPE_SIZE");
+    if (size) {
+        pipe_size_max = size;
+        pipe_size_pinned = 1;
+    }
+}
+
+/* Our stdio file descriptions are shared with the calling shell, which
+   does not expect them to stay non-blocking, so their flags are put back
+   before we exit, whether normally or through a signal. */
+static int stdio_flags[3] = { -1, -1, -1 };
+
+static void stdio_restore(void) {
+    for (int fd = 0; fd < 3; fd++)
+        if (stdio_flags[fd] != -1) fcntl(fd, F_SETFL, stdio_flags[fd]);
+}
+
+static void stdio_set_nonblock(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    /* Another of our fds may share the file description and have set
+       it already; then the flags saved for that one are the original. */
+    if (flags == -1 || flags & O_NONBLOCK) return;
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0) stdio_flags[fd] = flags;
+}
+
+static void relay_init(struct relay *r, int in_fd, int out_fd, int pipe_fd) {
+    memset(r, 0, sizeof(*r));
+    r->in_fd = in_fd;
+    r->out_fd = out_fd;
+    r->pipe_fd = pipe_fd;
+    r->use_splice = !no_splice;
+    if (fcntl(pipe_fd, F_SETFL, fcntl(pipe_fd, F_GETFL) | O_NONBLOCK) == -1)
+        err(EXIT_FAILURE, "relay_init");
+    stdio_set_nonblock(in_fd == pipe_fd ? out_fd : in_fd);
+#ifdef F_SETPIPE_SZ
+    if (pipe_size_pinned) {
+        if (fcntl(pipe_fd, F_SETPIPE_SZ, (int)pipe_size_max) == -1)
+            warn("cannot set pipe size to %zu", pipe_size_max);
+    } else {
+        int size = fcntl(pipe_fd, F_GETPIPE_SZ);
+        if (size > 0) r->pipe_size = size;
+    }
+#endif
+}
+
+static void relay_finish(struct relay *r) {
+    if (r->done) return;
+    close(r->pipe_fd);
+    free(r->buf);
+    r->buf = NULL;
+    r->done = 1;
+}
+
+/* Called after every successful transfer of sz bytes. */
+static void relay_grow(struct relay *r, size_t sz) {
+    if (r->bytes == 0) r->first_byte_us = now_us() - start_us;
+    r->bytes += sz;
+
+    if (r->buf && sz == r->size && r->size < buffer_max) {
+        size_t size = r->size * 2 < buffer_max ? r->size * 2 : buffer_max;
+        char *buf = realloc(r->buf, size);
+        if (buf) {
+            r->buf = buf;
+            r->size = size;
         }
     }
+#ifdef F_SETPIPE_SZ
+    if (r->pipe_size && sz >= r->pipe_size) {
+        size_t size = r->pipe_size * 2;
+        /* Unprivileged processes cannot exceed /proc/sys/fs/pipe-max-size
+           and may be limited further by pipe-user-pages-soft. */
+        if (size > pipe_size_max || fcntl(r->pipe_fd, F_SETPIPE_SZ, (int)size) == -1)
+            r->pipe_size = 0;
+        else
+            r->pipe_size = size;
+    }
+#endif
 }
 
-int p_std_in[2], p_std_out[2], p_std_err[2];
+static int writable(int fd) {
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+    return poll(&pfd, 1, 0) == 1 && pfd.revents == POLLOUT;
+}
 
-void *pump_stdin(void *ignore) {
-    pump(STDIN_FILENO, p_std_in[1]);
-    close(p_std_in[1]);
-    return NULL;
+/* Move data inside the kernel. Returns 1 if splice() is not supported for
+   this fd combination, in which case nothing has been consumed. */
+static int relay_splice(struct relay *r) {
+    ssize_t sz = TEMP_FAILURE_RETRY(splice(r->in_fd, NULL, r->out_fd, NULL, SPLICE_CHUNK,
+                                           SPLICE_F_MOVE | SPLICE_F_MORE | SPLICE_F_NONBLOCK));
+    r->syscalls++;
+    if (sz > 0) {
+        r->out_blocked = 0;
+        relay_grow(r, sz);
+    } else if (sz == 0) {
+        relay_finish(r);
+    } else if (errno == EAGAIN) {
+        /* Either the input ran dry or the output is full. Only wait for
+           the input if the output can take more. */
+        r->out_blocked = !writable(r->out_fd);
+    } else if (errno == EINVAL || errno == ENOSYS) {
+        /* EINVAL: out_fd is opened with O_APPEND or its file type has no
+           splice support (e.g. a tty on older kernels), ENOSYS: no splice. */
+        return 1;
+    } else {
+        relay_finish(r);
+    }
+    return 0;
 }
 
-void *pump_stdout(void *ignore) {
-    pump(p_std_out[0], STDOUT_FILENO);
-    close(p_std_out[0]);
-    return NULL;
+static void relay_copy(struct relay *r) {
+    ssize_t sz;
+    if (r->buf == NULL) {
+        r->size = buffer_size;
+        r->buf = malloc(r->size);
+        if (r->buf == NULL) err(EXIT_FAILURE, "malloc");
+    }
+    if (r->len == 0) {
+        sz = TEMP_FAILURE_RETRY(read(r->in_fd, r->buf, r->size));
+        r->syscalls++;
+        if (sz < 0 && errno == EAGAIN) return;
+        if (sz <= 0) {
+            relay_finish(r);
+            return;
+        }
+        r->len = sz;
+        r->off = 0;
+        relay_grow(r, sz);
+    }
+    while (r->len) {
+        sz = TEMP_FAILURE_RETRY(write(r->out_fd, r->buf + r->off, r->len));
+        r->syscalls++;
+        if (sz < 0 && errno == EAGAIN) {
+            r->out_blocked = 1;
+            return;
+        }
+        if (sz <= 0) {
+            relay_finish(r);
+            return;
+        }
+        r->off += sz;
+        r->len -= sz;
+    }
+    r->out_blocked = 0;
 }
 
-void *pump_stderr(void *ignore) {
-    pump(p_std_err[0], STDERR_FILENO);
-    close(p_std_err[0]);
-    return NULL;
+static void relay_step(struct relay *r) {
+    if (r->use_splice && relay_splice(r) == 0) return;
+    r->use_splice = 0;
+    relay_copy(r);
+}
+
+static void relay_poll(struct relay *r, struct pollfd *pfd) {
+    if (r->done) {
+        pfd->fd = -1;
+    } else if (r->out_blocked) {
+        pfd->fd = r->out_fd;
+        pfd->events = POLLOUT;
+    } else {
+        pfd->fd = r->in_fd;
+        pfd->events = POLLIN;
+    }
+    pfd->revents = 0;
+}
+
+static size_t json_escape(char *out, size_t size, const char *str) {
+    size_t n = 0;
+    for (; *str && n + 7 < size; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\')
+            n += snprintf(out + n, size - n, "\\%c", c);
+        else if (c < 0x20)
+            n += snprintf(out + n, size - n, "\\u%04x", c);
+        else
+            out[n++] = c;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+/* Times are in microseconds since startup, -1 if unknown. */
+static void stats_write(const char *mode, char **argv, const struct relay *relays,
+                        const int *pass, int status, long long spawn_us, long long exec_us) {
+    static const char *names[3] = { "stdin", "stdout", "stderr" };
+    char line[2048], command[512];
+    size_t n = 0;
+
+    json_escape(command, sizeof(command), argv[0] && argv[1] ? argv[1] : "");
+    n += snprintf(line + n, sizeof(line) - n,
+                  "{\"time\":%lld,\"command\":\"%s\",\"mode\":\"%s\",\"status\":%d,"
+                  "\"wall_us\":%lld,\"spawn_us\":%lld,\"exec_us\":%lld,\"streams\":{",
+                  (long long)time(NULL), command, mode, status,
+                  now_us() - start_us, spawn_us, exec_us);
+    for (int fd = 0; fd < 3; fd++) {
+        const struct relay *r = &relays[fd];
+        n += snprintf(line + n, sizeof(line) - n,
+                      "%s\"%s\":{\"relayed\":%s,\"splice\":%s,\"bytes\":%llu,"
+                      "\"syscalls\":%llu,\"first_byte_us\":%lld}",
+                      fd ? "," : "", names[fd], pass[fd] ? "false" : "true",
+                      !pass[fd] && r->use_splice ? "true" : "false",
+                      r->bytes, r->syscalls, r->bytes ? r->first_byte_us : -1);
+    }
+    n += snprintf(line + n, sizeof(line) - n, "}}\n");
+    if (n >= sizeof(line)) return;
+
+    /* A single O_APPEND write keeps lines of concurrent calls intact. */
+    int fd = open(stats_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) return;
+    TEMP_FAILURE_RETRY(write(fd, line, n));
+    close(fd);
+}
+
+/* /system/bin/cmd hands its stdio over to system_server, which is not
+   allowed to use our terminal. Anonymous pipes created inside the app are
+   fine though (that is what the relay uses), so those are given to the
+   child directly. Named fifos and regular files carry file labels that
+   system_server may not access and keep going through the relay. */
+static int can_pass_through(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISFIFO(st.st_mode)) return 0;
+
+    char path[32], target[8];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    ssize_t len = readlink(path, target, sizeof(target));
+    return len >= 5 && memcmp(target, "pipe:", 5) == 0;
+}
+
+static const int exit_signals[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM };
+
+/* Pass the signal on to the child, so that it does not outlive us, and
+   then die from it like we would have without blocking it. */
+static void exit_by_signal(int sig, pid_t pid) {
+    if (pid > 0) kill(pid, sig);
+    stdio_restore();
+    signal(sig, SIG_DFL);
+    raise(sig);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, sig);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    exit(EXIT_FAILURE);
 }
 
 void replace_fd(int fd, int target_fd) {
@@ -77,47 +374,138 @@ void replace_fd(int fd, int target_fd) {
 }
 
 int main(int argc, char **argv) {
-    if (pipe(p_std_in) == -1) err(EXIT_FAILURE, "pipe");
-    if (pipe(p_std_out) == -1) err(EXIT_FAILURE, "pipe");
-    if (pipe(p_std_err) == -1) err(EXIT_FAILURE, "pipe");
+    stats_path = getenv("TERMUX_CMD_STATS");
+    if (stats_path && *stats_path == '\0') stats_path = NULL;
+    if (stats_path) start_us = now_us();
 
-    pid_t pid = fork();
+    relay_setup();
+
+    /* pipes[fd][0] is the read end, so the child uses pipes[0][0] for
+       stdin and pipes[fd][1] for stdout and stderr. */
+    int pass[3], pipes[3][2], child_fds[3];
+    int relayed = 0;
+    for (int fd = 0; fd < 3; fd++) {
+        pass[fd] = !no_passthrough && can_pass_through(fd);
+        if (!pass[fd]) relayed = 1;
+    }
+
+    if (!relayed) {
+        if (stats_path) {
+            struct relay none[3];
+            memset(none, 0, sizeof(none));
+            stats_write("exec", argv, none, pass, -1, -1, -1);
+        }
+        execv(CMD_PATH, argv);
+        err(EXIT_FAILURE, "exec");
+    }
+
+    for (int fd = 0; fd < 3; fd++) {
+        if (pass[fd]) {
+            child_fds[fd] = fd;
+            continue;
+        }
+        if (pipe2(pipes[fd], O_CLOEXEC) == -1) err(EXIT_FAILURE, "pipe");
+        child_fds[fd] = pipes[fd][fd == STDIN_FILENO ? 0 : 1];
+    }
+
+    /* With stats enabled, the end of exec() is seen as EOF on exec_pipe. */
+    int exec_pipe[2] = { -1, -1 };
+    long long spawn_us = -1, exec_us = -1;
+    if (stats_path && pipe2(exec_pipe, O_CLOEXEC) == -1) exec_pipe[0] = exec_pipe[1] = -1;
+
+    /* SIGCHLD is consumed through a signalfd so that reaping the child is
+       just another event in the relay loop. Block it before forking to not
+       miss an early exit. Signals that would terminate us are taken the
+       same way, to restore our stdio first. */
+    sigset_t sig_mask, orig_mask;
+    sigemptyset(&sig_mask);
+    sigaddset(&sig_mask, SIGCHLD);
+    for (size_t i = 0; i < sizeof(exit_signals) / sizeof(exit_signals[0]); i++)
+        sigaddset(&sig_mask, exit_signals[i]);
+    if (sigprocmask(SIG_BLOCK, &sig_mask, &orig_mask) == -1) err(EXIT_FAILURE, "sigprocmask");
 
+    pid_t pid = fork();
     if (pid < 0) {
         err(EXIT_FAILURE, "fork");
-    } else if (pid > 0) {
-        close(p_std_in[0]);
-        close(p_std_out[1]);
-        close(p_std_err[1]);
-
-        signal(SIGPIPE, SIG_IGN);
+    } else if (pid == 0) {
+        if (sigprocmask(SIG_SETMASK, &orig_mask, NULL) == -1) err(EXIT_FAILURE, "sigprocmask");
 
-        pthread_t t_stdin;
-        pthread_create(&t_stdin, NULL, pump_stdin, NULL);
-        pthread_detach(t_stdin);
+        for (int fd = 0; fd < 3; fd++)
+            if (!pass[fd]) replace_fd(child_fds[fd], fd);
 
-        pthread_t t_stdout;
-        pthread_create(&t_stdout, NULL, pump_stdout, NULL);
+        execv(CMD_PATH, argv);
+        err(EXIT_FAILURE, "exec");
+    }
 
-        pthread_t t_stderr;
-        pthread_create(&t_stderr, NULL, pump_stderr, NULL);
+    int sig_fd = signalfd(-1, &sig_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sig_fd == -1) err(EXIT_FAILURE, "signalfd");
+    if (exec_pipe[1] != -1) close(exec_pipe[1]);
+    if (stats_path) spawn_us = now_us() - start_us;
 
-        int status;
-        if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) < 0) err(EXIT_FAILURE, "wait");
+    for (int fd = 0; fd < 3; fd++)
+        if (!pass[fd]) close(child_fds[fd]);
 
-        pthread_join(t_stdout, NULL);
-        pthread_join(t_stderr, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    atexit(stdio_restore);
 
-        if (WIFEXITED(status))
-            exit(WEXITSTATUS(status));
+    struct relay relays[3];
+    memset(relays, 0, sizeof(relays));
+    for (int fd = 0; fd < 3; fd++) {
+        if (pass[fd])
+            relays[fd].done = 1;
+        else if (fd == STDIN_FILENO)
+            relay_init(&relays[fd], STDIN_FILENO, pipes[fd][1], pipes[fd][1]);
         else
-            exit(EXIT_FAILURE);
-    } else {
-        replace_fd(p_std_in[0], STDIN_FILENO);
-        replace_fd(p_std_out[1], STDOUT_FILENO);
-        replace_fd(p_std_err[1], STDERR_FILENO);
+            relay_init(&relays[fd], pipes[fd][0], fd, pipes[fd][0]);
+    }
 
-        execv("/system/bin/cmd", argv);
-        err(EXIT_FAILURE, "exec");
+    int status = 0, reaped = 0;
+    struct pollfd pfds[5];
+    /* Like before, stdin is not waited for: we are done once the child
+       has exited and its output has been drained. */
+    while (!reaped || !relays[1].done || !relays[2].done) {
+        for (int i = 0; i < 3; i++) relay_poll(&relays[i], &pfds[i]);
+        pfds[3].fd = sig_fd;
+        pfds[3].events = POLLIN;
+        pfds[3].revents = 0;
+        pfds[4].fd = exec_pipe[0];
+        pfds[4].events = POLLIN;
+        pfds[4].revents = 0;
+
+        if (poll(pfds, 5, -1) == -1) {
+            if (errno == EINTR) continue;
+            err(EXIT_FAILURE, "poll");
+        }
+
+        for (int i = 0; i < 3; i++)
+            if (pfds[i].revents) relay_step(&relays[i]);
+
+        if (pfds[3].revents) {
+            struct signalfd_siginfo si;
+            while (read(sig_fd, &si, sizeof(si)) > 0)
+                if (si.ssi_signo != SIGCHLD) exit_by_signal(si.ssi_signo, reaped ? -1 : pid);
+        }
+
+        if (pfds[3].revents && !reaped) {
+            pid_t r = TEMP_FAILURE_RETRY(waitpid(pid, &status, WNOHANG));
+            if (r < 0) err(EXIT_FAILURE, "wait");
+            if (r == pid) reaped = 1;
+        }
+
+        if (pfds[4].revents) {
+            exec_us = now_us() - start_us;
+            close(exec_pipe[0]);
+            exec_pipe[0] = -1;
+        }
     }
+
+    if (stats_path)
+        stats_write("fork", argv, relays, pass,
+                    WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status),
+                    spawn_us, exec_us);
+
+    if (WIFEXITED(status))
+        exit(WEXITSTATUS(status));
+    else
+        exit(EXIT_FAILURE);
 }
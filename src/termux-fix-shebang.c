@@ -0,0 +1,279 @@
+/* termux-fix-shebang.c
+Copyright (C) 2025 Termux
+This file is part of termux-tools.
+termux-tools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+termux-tools is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with termux-tools.  If not, see
+<https://www.gnu.org/licenses/>.  */
+
+/* Rewrite shebangs for running under Termux: "#!<anything>/bin/<rest>",
+   with bin also being sbin or xbin, becomes "#!$PREFIX/bin/<rest>" like
+   `sed -E "1 s@^#!(.*)/[sx]?bin/(.*)@#!$PREFIX/bin/\2@"` did before. Only
+   the first line of a file is read to decide. Files that already have the
+   right shebang are not written at all, a shebang of the same length is
+   overwritten in place if the file is writable and otherwise the file is
+   copied to a temporary file that replaces it. Files are split between
+   several processes. */
+
+#define _GNU_SOURCE
+
+#include <ftw.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define NEW_PREFIX "#!" TERMUX_PREFIX "/bin/"
+
+static char **files;
+static size_t nfiles, alloc_files;
+
+static void usage(void) {
+    fprintf(stderr, "usage: termux-fix-shebang [-r] [-j jobs] <files>\n");
+    fprintf(stderr, "Rewrite shebangs in specified files for running under Termux,\n");
+    fprintf(stderr, "which is done by rewriting #!*/bin/binary to #!%s/bin/binary.\n\n", TERMUX_PREFIX);
+    fprintf(stderr, "  -r       rewrite all files below directories, without following symlinks\n");
+    fprintf(stderr, "  -j jobs  number of processes rewriting files (default: number of CPUs)\n");
+    exit(EXIT_FAILURE);
+}
+
+static void add_file(const char *path) {
+    if (nfiles == alloc_files) {
+        alloc_files = alloc_files ? alloc_files * 2 : 256;
+        files = realloc(files, alloc_files * sizeof(*files));
+        if (files == NULL) err(EXIT_FAILURE, "realloc");
+    }
+    if ((files[nfiles++] = strdup(path)) == NULL) err(EXIT_FAILURE, "strdup");
+}
+
+static int add_tree_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)ftw;
+    if (type == FTW_F && S_ISREG(st->st_mode)) add_file(path);
+    else if (type == FTW_DNR) warnx("%s: cannot read directory", path);
+    return 0;
+}
+
+static int compare_files(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Returns the rewritten first line, or NULL if it does not change. */
+static char *rewrite_line(const char *line, size_t len, size_t *new_len) {
+    if (len < 2 || line[0] != '#' || line[1] != '!') return NULL;
+
+    /* (.*) is greedy, so the last "/bin/", "/sbin/" or "/xbin/" counts. */
+    const char *rest = NULL;
+    for (size_t i = len; i-- > 2 && rest == NULL;) {
+        if (line[i] != '/') continue;
+        const char *p = line + i + 1;
+        size_t left = len - i - 1;
+        if (left >= 1 && (p[0] == 's' || p[0] == 'x')) p++, left--;
+        if (left >= 4 && memcmp(p, "bin/", 4) == 0) rest = p + 4;
+    }
+    if (rest == NULL) return NULL;
+
+    size_t rest_len = line + len - rest;
+    *new_len = strlen(NEW_PREFIX) + rest_len;
+    if (*new_len == len && memcmp(line, NEW_PREFIX, strlen(NEW_PREFIX)) == 0) return NULL;
+
+    char *new_line = malloc(*new_len);
+    if (new_line == NULL) err(EXIT_FAILURE, "malloc");
+    memcpy(new_line, NEW_PREFIX, strlen(NEW_PREFIX));
+    memcpy(new_line + strlen(NEW_PREFIX), rest, rest_len);
+    return new_line;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len) {
+        ssize_t t = write(fd, buf, len);
+        if (t < 0 && errno == EINTR) continue;
+        if (t < 0) return -1;
+        buf += t;
+        len -= t;
+    }
+    return 0;
+}
+
+/* Write the new first line followed by everything after the old one to
+   a temporary file next to path, then rename it over path. */
+static int replace_file(const char *path, int fd, const struct stat *st,
+                        const char *new_line, size_t new_len, off_t line_end) {
+    char tmp[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    int dir_len = slash ? (int)(slash - path + 1) : 0;
+    if (snprintf(tmp, sizeof(tmp), "%.*s.termux-fix-shebang.XXXXXX", dir_len, path) >= (int)sizeof(tmp)) {
+        warnx("%s: path too long", path);
+        return -1;
+    }
+    int out = mkstemp(tmp);
+    if (out == -1) {
+        warn("%s: cannot create temporary file", path);
+        return -1;
+    }
+
+    static char buf[64 * 1024];
+    int ret = write_all(out, new_line, new_len);
+    if (ret == 0 && lseek(fd, line_end, SEEK_SET) == -1) ret = -1;
+    while (ret == 0) {
+        ssize_t sz = read(fd, buf, sizeof(buf));
+        if (sz < 0 && errno == EINTR) continue;
+        if (sz <= 0) {
+            if (sz < 0) ret = -1;
+            break;
+        }
+        ret = write_all(out, buf, sz);
+    }
+    /* Keep the owner and mode, as sed -i did. */
+    if (ret == 0 && fchown(out, st->st_uid, st->st_gid) == -1 && errno != EPERM) ret = -1;
+    if (ret == 0 && fchmod(out, st->st_mode & 07777) == -1) ret = -1;
+    if (close(out) == -1) ret = -1;
+    if (ret == 0 && rename(tmp, path) == -1) ret = -1;
+    if (ret == -1) {
+        warn("%s", path);
+        unlink(tmp);
+    }
+    return ret;
+}
+
+static int fix_file(const char *path) {
+    /* Only opened for reading, files that need no change or are replaced
+       may be read-only or running. */
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        warn("%s", path);
+        return -1;
+    }
+
+    /* Shebangs are short, the buffer only grows for long first lines. */
+    size_t cap = 256, len = 0;
+    char *line = malloc(cap), *nl = NULL;
+    if (line == NULL) err(EXIT_FAILURE, "malloc");
+    int ret = 0;
+    for (;;) {
+        ssize_t sz = read(fd, line + len, cap - len);
+        if (sz < 0 && errno == EINTR) continue;
+        if (sz < 0) {
+            warn("%s", path);
+            ret = -1;
+        }
+        if (sz <= 0) break;
+        if (len == 0 && (line[0] != '#' || (sz > 1 && line[1] != '!'))) break;
+        nl = memchr(line + len, '\n', sz);
+        len += sz;
+        if (nl) break;
+        if (len == cap && (line = realloc(line, cap *= 2)) == NULL) err(EXIT_FAILURE, "realloc");
+    }
+    size_t line_len = nl ? (size_t)(nl - line) : len;
+
+    size_t new_len;
+    char *new_line = ret == 0 ? rewrite_line(line, line_len, &new_len) : NULL;
+    /* Files that cannot be written are replaced instead, as sed -i did. */
+    int out = -1;
+    if (new_line && new_len == line_len) out = open(path, O_WRONLY | O_CLOEXEC);
+    if (out != -1) {
+        if (pwrite(out, new_line, new_len, 0) != (ssize_t)new_len) {
+            warn("%s", path);
+            ret = -1;
+        }
+        close(out);
+    } else if (new_line) {
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            warn("%s", path);
+            ret = -1;
+        } else {
+            ret = replace_file(path, fd, &st, new_line, new_len, line_len);
+        }
+    }
+
+    free(new_line);
+    free(line);
+    close(fd);
+    return ret;
+}
+
+int main(int argc, char **argv) {
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int recursive = 0, opt;
+    while ((opt = getopt(argc, argv, "rj:h")) != -1) {
+        switch (opt) {
+        case 'r': recursive = 1; break;
+        case 'j':
+            jobs = strtol(optarg, NULL, 10);
+            if (jobs < 1) usage();
+            break;
+        default: usage();
+        }
+    }
+    if (optind == argc) usage();
+    if (jobs < 1) jobs = 1;
+
+    int status = EXIT_SUCCESS;
+    for (int i = optind; i < argc; i++) {
+        struct stat st;
+        if (recursive && lstat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (nftw(argv[i], add_tree_entry, 16, FTW_PHYS) == -1) {
+                warn("%s", argv[i]);
+                status = EXIT_FAILURE;
+            }
+            continue;
+        }
+        /* Symlinks given explicitly are resolved, so that their target is
+           rewritten instead of replacing them with a file. */
+        char *real = realpath(argv[i], NULL);
+        if (real == NULL || stat(real, &st) == -1) {
+            warn("%s", argv[i]);
+            status = EXIT_FAILURE;
+        } else if (!S_ISREG(st.st_mode)) {
+            warnx("%s: not a regular file", argv[i]);
+            status = EXIT_FAILURE;
+        } else {
+            add_file(real);
+        }
+        free(real);
+    }
+
+    /* Two workers must not replace the same file at once. */
+    qsort(files, nfiles, sizeof(*files), compare_files);
+    size_t unique = 0;
+    for (size_t i = 0; i < nfiles; i++) {
+        if (unique && strcmp(files[unique - 1], files[i]) == 0) free(files[i]);
+        else files[unique++] = files[i];
+    }
+    nfiles = unique;
+
+    if ((size_t)jobs > nfiles) jobs = nfiles ? nfiles : 1;
+    if (jobs == 1) {
+        for (size_t i = 0; i < nfiles; i++)
+            if (fix_file(files[i]) == -1) status = EXIT_FAILURE;
+        return status;
+    }
+
+    for (long job = 0; job < jobs; job++) {
+        pid_t pid = fork();
+        if (pid < 0) err(EXIT_FAILURE, "fork");
+        if (pid == 0) {
+            int ret = EXIT_SUCCESS;
+            for (size_t i = job; i < nfiles; i += jobs)
+                if (fix_file(files[i]) == -1) ret = EXIT_FAILURE;
+            _exit(ret);
+        }
+    }
+    int wstatus;
+    while (wait(&wstatus) > 0)
+        if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) status = EXIT_FAILURE;
+    return status;
+}
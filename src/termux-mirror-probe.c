@@ -0,0 +1,566 @@
+/* termux-mirror-probe.c
+Copyright (C) 2025 Termux
+This file is part of termux-tools.
+termux-tools is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or (at
+your option) any later version.
+termux-tools is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+You should have received a copy of the GNU General Public License
+along with termux-tools.  If not, see
+<https://www.gnu.org/licenses/>.  */
+
+/* Check the availability of many mirrors at once, for pkg and
+   termux-change-repo.
+
+   Reads lines of the form "<id> <url>" from stdin and requests
+   <url>/dists/stable/Release from all of them concurrently, with one
+   deadline for the whole run. As soon as the result for a mirror is
+   known, "<id> ok <connect-ms> <ttfb-ms>" or "<id> bad" is written, with
+   the time until the TCP connection was established and until the first
+   byte of the response arrived. Every mirror still pending when the
+   deadline passes is reported as bad.
+
+   With -f, the run ends as soon as one mirror answered within the given
+   number of milliseconds, and mirrors still pending are not reported.
+
+   -r checks another file of the repository, and with -z the request is
+   conditional on the file having changed since the given time: mirrors
+   answering HTTP 304 are reported as "<id> unmodified <connect-ms>
+   <ttfb-ms>".
+
+   With -m, the lines are paths of mirror files instead, relative to the
+   directory given with -d, which are used as ids. They are parsed like
+   mirrors/generate-index.sh does, and -l prints them in the format of
+   mirrors.index instead of checking them.
+
+   -R holds back the results until all are known and prints them ranked
+   by response time, bad mirrors last. -s finally writes "<id> selected
+   <n>" for a mirror picked at random among the working ones, the way pkg
+   always did: by weight, scaled down by the square of how much slower
+   than the fastest mirror it is. <n> is the number drawn. Without -m,
+   the weight can follow the url and defaults to 1, and a known response
+   time after that means the mirror is not checked again but still takes
+   part in the selection.
+
+   All checks share DNS results, connections and TLS sessions, and wait
+   for an HTTP/2 connection to a host already being connected to instead
+   of opening another one, as several mirrors share hosts. With -c, TLS
+   sessions are read from and saved to the given file, so that the next
+   run can resume them instead of doing a full handshake. Saving them
+   needs libcurl 8.12 or later. */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+#include <time.h>
+
+#include <curl/curl.h>
+
+#define USER_AGENT "Termux-PKG/2.0 mirror-checker (termux-tools " PACKAGE_VERSION ") " \
+    "Termux (" TERMUX_APP_PACKAGE "; install-prefix:" TERMUX_PREFIX ")"
+
+/* Response times below this are considered noise when selecting. */
+#define MIN_TTFB_MS 50
+
+enum result { PENDING, OK, UNMODIFIED, BAD };
+
+static const char *const result_names[] = { "pending", "ok", "unmodified", "bad" };
+
+struct mirror {
+    char *id;
+    char *main, *root, *x11;
+    char *url;
+    long weight;
+    CURL *easy;
+    enum result result;
+    long connect_ms, ttfb_ms;
+    int known;
+};
+
+static struct mirror *mirrors;
+static size_t nmirrors, alloc_mirrors;
+static const char *path = "dists/stable/Release";
+static int rank;
+
+static void usage(void) {
+    fprintf(stderr, "Usage: termux-mirror-probe [-t timeout] [-j jobs] [-f ms] [-r path] [-z time] [-R] [-s]\n");
+    fprintf(stderr, "       termux-mirror-probe -m [-d dir] [-l] [options]\n\n");
+    fprintf(stderr, "Read \"<id> <url>\" lines from stdin, check <url>/dists/stable/Release\n");
+    fprintf(stderr, "of all of them concurrently and print \"<id> ok <connect-ms> <ttfb-ms>\"\n");
+    fprintf(stderr, "or \"<id> bad\" as results arrive.\n\n");
+    fprintf(stderr, "  -t timeout  seconds until all pending mirrors count as bad (default 5)\n");
+    fprintf(stderr, "  -j jobs     maximum number of simultaneous connections (default 64)\n");
+    fprintf(stderr, "  -f ms       stop after the first mirror that answered within ms\n");
+    fprintf(stderr, "  -r path     check <url>/path instead\n");
+    fprintf(stderr, "  -z time     report \"<id> unmodified\" if not modified since time (unix)\n");
+    fprintf(stderr, "  -R          print all results at the end, fastest first\n");
+    fprintf(stderr, "  -s          print \"<id> selected <n>\" for a mirror picked like pkg does\n");
+    fprintf(stderr, "  -m          read paths of mirror files instead\n");
+    fprintf(stderr, "  -d dir      directory relative paths of mirror files are in\n");
+    fprintf(stderr, "  -l          only print the parsed mirror files, like mirrors.index\n");
+    fprintf(stderr, "  -c file     file to resume TLS sessions from and save them to\n");
+    fprintf(stderr, "  -V          print version and exit\n");
+    exit(EXIT_FAILURE);
+}
+
+static struct mirror *add_mirror(const char *id, const char *url, long weight) {
+    if (nmirrors == alloc_mirrors) {
+        alloc_mirrors = alloc_mirrors ? alloc_mirrors * 2 : 64;
+        mirrors = realloc(mirrors, alloc_mirrors * sizeof(*mirrors));
+        if (mirrors == NULL) err(EXIT_FAILURE, "realloc");
+    }
+    struct mirror *m = &mirrors[nmirrors++];
+    memset(m, 0, sizeof(*m));
+    size_t url_len = strlen(url);
+    while (url_len && url[url_len - 1] == '/') url_len--;
+    m->id = strdup(id);
+    m->main = strdup(url);
+    if (asprintf(&m->url, "%.*s/%s", (int)url_len, url, path) == -1)
+        m->url = NULL;
+    if (m->id == NULL || m->main == NULL || m->url == NULL) err(EXIT_FAILURE, "strdup");
+    m->weight = weight;
+    m->connect_ms = m->ttfb_ms = -1;
+    return m;
+}
+
+/* Parse a non-negative number, returning -1 if str is not one. */
+static long parse_number(const char *str) {
+    if (str == NULL || *str == '\0' || strspn(str, "0123456789") != strlen(str)) return -1;
+    return strtol(str, NULL, 10);
+}
+
+static void read_mirror_urls(void) {
+    char *line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, stdin) != -1) {
+        char *save, *id = strtok_r(line, " \n", &save);
+        char *url = strtok_r(NULL, " \n", &save);
+        char *weight = strtok_r(NULL, " \n", &save);
+        char *ttfb = strtok_r(NULL, " \n", &save);
+        if (id == NULL || url == NULL) continue;
+
+        struct mirror *m = add_mirror(id, url, weight ? parse_number(weight) : 1);
+        if (m->weight < 0) errx(EXIT_FAILURE, "%s: invalid weight '%s'", id, weight);
+        if (ttfb) {
+            if ((m->ttfb_ms = parse_number(ttfb)) < 0) errx(EXIT_FAILURE, "%s: invalid time '%s'", id, ttfb);
+            m->result = OK;
+            m->known = 1;
+        }
+    }
+    free(line);
+}
+
+static int valid_url(const char *file, const char *channel, const char *url) {
+    if ((strncmp(url, "http://", 7) == 0 || strncmp(url, "https://", 8) == 0) &&
+        strcspn(url, " \t\n\r\v\f") == strlen(url))
+        return 1;
+    warnx("%s: invalid %s url '%s'", file, channel, url);
+    return 0;
+}
+
+/* Read the NAME=value assignments of the mirror file at file, with value
+   optionally quoted. Mirror files are sourced by older versions of pkg,
+   but never contain anything else. Returns 0 if it cannot be used. */
+static int parse_mirror_file(const char *id, const char *file) {
+    FILE *f = fopen(file, "r");
+    if (f == NULL) {
+        warn("%s", file);
+        return 0;
+    }
+
+    char *vars[4] = { NULL };
+    static const char *const names[4] = { "MAIN", "ROOT", "X11", "WEIGHT" };
+    char *line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, f) != -1) {
+        char *p = line + strspn(line, " \t");
+        size_t name_len = strcspn(p, "=");
+        if (p[name_len] != '=' || *p == '#') continue;
+        char *value = p + name_len + 1;
+        size_t value_len;
+        if (*value == '"' || *value == '\'') {
+            char *end = strchr(value + 1, *value);
+            if (end == NULL) continue;
+            value_len = end - ++value;
+        } else {
+            value_len = strcspn(value, " \t\n#;");
+        }
+        for (int i = 0; i < 4; i++) {
+            if (strlen(names[i]) != name_len || strncmp(p, names[i], name_len) != 0) continue;
+            free(vars[i]);
+            if ((vars[i] = strndup(value, value_len)) == NULL) err(EXIT_FAILURE, "strdup");
+        }
+    }
+    free(line);
+    fclose(f);
+
+    long weight = parse_number(vars[3]);
+    int ok = 1;
+    if (vars[0] == NULL || *vars[0] == '\0') {
+        warnx("%s: no main channel url", file);
+        ok = 0;
+    }
+    ok = ok && valid_url(file, "main", vars[0]);
+    ok = ok && (vars[1] == NULL || *vars[1] == '\0' || valid_url(file, "root", vars[1]));
+    ok = ok && (vars[2] == NULL || *vars[2] == '\0' || valid_url(file, "x11", vars[2]));
+    if (ok && weight < 0) {
+        warnx("%s: invalid weight '%s'", file, vars[3] ? vars[3] : "");
+        ok = 0;
+    }
+
+    if (ok) {
+        struct mirror *m = add_mirror(id, vars[0], weight);
+        if (vars[1] && *vars[1] && (m->root = strdup(vars[1])) == NULL) err(EXIT_FAILURE, "strdup");
+        if (vars[2] && *vars[2] && (m->x11 = strdup(vars[2])) == NULL) err(EXIT_FAILURE, "strdup");
+    }
+    for (int i = 0; i < 4; i++) free(vars[i]);
+    return ok;
+}
+
+static void read_mirror_files(const char *dir) {
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, stdin)) != -1) {
+        if (len && line[len - 1] == '\n') line[--len] = '\0';
+        if (len == 0) continue;
+
+        char *file = line;
+        if (dir && line[0] != '/' && asprintf(&file, "%s/%s", dir, line) == -1)
+            err(EXIT_FAILURE, "asprintf");
+        parse_mirror_file(line, file);
+        if (file != line) free(file);
+    }
+    free(line);
+}
+
+/* Print the mirrors like mirrors/generate-index.sh, the region being the
+   directory of the mirror. */
+static void list_mirrors(void) {
+    for (size_t i = 0; i < nmirrors; i++) {
+        struct mirror *m = &mirrors[i];
+        const char *slash = strrchr(m->id, '/'), *region = m->id;
+        int region_len = slash ? (int)(slash - m->id) : 0;
+        if (slash) {
+            while (slash > m->id && slash[-1] != '/') slash--;
+            region_len -= slash - m->id;
+            region = slash;
+        }
+        if (region_len == 0) {
+            region = "default";
+            region_len = strlen(region);
+        }
+        printf("%s %.*s %ld %s %s %s\n", m->id, region_len, region, m->weight, m->main,
+               m->root ? m->root : "-", m->x11 ? m->x11 : "-");
+    }
+}
+
+static void print_result(const struct mirror *m) {
+    if (m->result == BAD)
+        printf("%s bad\n", m->id);
+    else
+        printf("%s %s %ld %ld\n", m->id, result_names[m->result], m->connect_ms, m->ttfb_ms);
+    fflush(stdout);
+}
+
+/* Returns the time to first byte in milliseconds, or -1 for a bad mirror. */
+static long report(struct mirror *m, int ok) {
+    m->result = BAD;
+    if (ok) {
+        curl_off_t connect = 0, ttfb = 0;
+        long unmet = 0;
+        curl_easy_getinfo(m->easy, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(m->easy, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+        curl_easy_getinfo(m->easy, CURLINFO_CONDITION_UNMET, &unmet);
+        m->result = unmet ? UNMODIFIED : OK;
+        m->connect_ms = connect / 1000;
+        m->ttfb_ms = ttfb / 1000;
+    }
+    if (!rank) print_result(m);
+    return m->ttfb_ms;
+}
+
+static int compare_ranks(const void *a, const void *b) {
+    const struct mirror *x = *(struct mirror *const *)a, *y = *(struct mirror *const *)b;
+    if ((x->result == BAD) != (y->result == BAD)) return x->result == BAD ? 1 : -1;
+    if (x->ttfb_ms != y->ttfb_ms) return x->ttfb_ms < y->ttfb_ms ? -1 : 1;
+    return x < y ? -1 : x > y;
+}
+
+static void print_ranked(void) {
+    struct mirror **ranked = malloc(nmirrors * sizeof(*ranked));
+    size_t n = 0;
+    if (ranked == NULL) err(EXIT_FAILURE, "malloc");
+    for (size_t i = 0; i < nmirrors; i++)
+        if (mirrors[i].result != PENDING && !mirrors[i].known) ranked[n++] = &mirrors[i];
+    qsort(ranked, n, sizeof(*ranked), compare_ranks);
+    for (size_t i = 0; i < n; i++) print_result(ranked[i]);
+    free(ranked);
+}
+
+static uint64_t random_number(void) {
+    uint64_t r;
+    FILE *f = fopen("/dev/urandom", "r");
+    if (f == NULL || fread(&r, sizeof(r), 1, f) != 1) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        srandom(ts.tv_nsec ^ getpid());
+        r = (uint64_t)random() << 33 ^ (uint64_t)random() << 2 ^ random();
+    }
+    if (f) fclose(f);
+    return r;
+}
+
+/* Pick a working mirror at random. Every weight is scaled by the square
+   of how much slower than the fastest mirror it is, so that a mirror with
+   10 times the latency of the best one is picked 100 times less often
+   relative to its weight, but never drops out entirely. */
+static void select_mirror(void) {
+    long fastest = -1;
+    for (size_t i = 0; i < nmirrors; i++) {
+        struct mirror *m = &mirrors[i];
+        if (m->result != OK && m->result != UNMODIFIED) continue;
+        long ttfb = m->ttfb_ms < MIN_TTFB_MS ? MIN_TTFB_MS : m->ttfb_ms;
+        if (fastest == -1 || ttfb < fastest) fastest = ttfb;
+    }
+    if (fastest == -1) return;
+
+    /* Weights are multiplied by 1000 to keep some resolution, rounding up. */
+    uint64_t *weights = calloc(nmirrors, sizeof(*weights)), total = 0;
+    if (weights == NULL) err(EXIT_FAILURE, "calloc");
+    for (size_t i = 0; i < nmirrors; i++) {
+        struct mirror *m = &mirrors[i];
+        if (m->result != OK && m->result != UNMODIFIED) continue;
+        uint64_t ttfb = m->ttfb_ms < MIN_TTFB_MS ? MIN_TTFB_MS : m->ttfb_ms;
+        weights[i] = ((uint64_t)m->weight * 1000 * fastest * fastest + ttfb * ttfb - 1) / (ttfb * ttfb);
+        total += weights[i];
+    }
+
+    /* Redraw numbers in the incomplete last round of the modulo, so that
+       all numbers below the total are equally likely. */
+    if (total > 0) {
+        uint64_t r, limit = UINT64_MAX - UINT64_MAX % total;
+        while ((r = random_number()) >= limit);
+        r %= total;
+        uint64_t left = r;
+        for (size_t i = 0; i < nmirrors; i++) {
+            if (left < weights[i]) {
+                printf("%s selected %llu\n", mirrors[i].id, (unsigned long long)r);
+                break;
+            }
+            left -= weights[i];
+        }
+    }
+    free(weights);
+}
+
+#if CURL_AT_LEAST_VERSION(8, 12, 0)
+/* The session file has one "<valid-until> <hmac> <session>" line per TLS
+   session, with both of the latter in hex. libcurl only exports the salted
+   hash of the host a session is for. */
+static unsigned char *from_hex(const char *hex, size_t *len) {
+    size_t hex_len = strlen(hex);
+    if (hex_len == 0 || hex_len % 2 || strspn(hex, "0123456789abcdef") != hex_len) return NULL;
+    unsigned char *data = malloc(hex_len / 2);
+    if (data == NULL) err(EXIT_FAILURE, "malloc");
+    for (size_t i = 0; i < hex_len / 2; i++)
+        sscanf(hex + 2 * i, "%2hhx", &data[i]);
+    *len = hex_len / 2;
+    return data;
+}
+
+static void write_hex(FILE *f, const unsigned char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) fprintf(f, "%02x", data[i]);
+}
+
+static void load_sessions(CURL *easy, const char *file) {
+    FILE *f = fopen(file, "r");
+    if (f == NULL) return;
+    char *line = NULL;
+    size_t cap = 0;
+    time_t now = time(NULL);
+    while (getline(&line, &cap, f) != -1) {
+        char *save, *valid_until = strtok_r(line, " \n", &save);
+        char *hmac_hex = strtok_r(NULL, " \n", &save);
+        char *session_hex = strtok_r(NULL, " \n", &save);
+        if (session_hex == NULL || parse_number(valid_until) < now) continue;
+
+        size_t hmac_len, session_len;
+        unsigned char *hmac = from_hex(hmac_hex, &hmac_len), *session = from_hex(session_hex, &session_len);
+        if (hmac && session) curl_easy_ssls_import(easy, NULL, hmac, hmac_len, session, session_len);
+        free(hmac);
+        free(session);
+    }
+    free(line);
+    fclose(f);
+}
+
+static CURLcode save_session(CURL *easy, void *userptr, const char *session_key,
+                             const unsigned char *hmac, size_t hmac_len,
+                             const unsigned char *session, size_t session_len,
+                             curl_off_t valid_until, int ietf_tls_id, const char *alpn,
+                             size_t earlydata_max) {
+    (void)easy, (void)session_key, (void)ietf_tls_id, (void)alpn, (void)earlydata_max;
+    FILE *f = userptr;
+    if (hmac == NULL || hmac_len == 0 || session_len == 0) return CURLE_OK;
+    fprintf(f, "%lld ", (long long)valid_until);
+    write_hex(f, hmac, hmac_len);
+    fputc(' ', f);
+    write_hex(f, session, session_len);
+    fputc('\n', f);
+    return CURLE_OK;
+}
+
+/* Failing to save the sessions only costs full handshakes next time. */
+static void save_sessions(CURL *easy, const char *file) {
+    char *tmp;
+    if (asprintf(&tmp, "%s.XXXXXX", file) == -1) err(EXIT_FAILURE, "asprintf");
+    int fd = mkstemp(tmp);
+    FILE *f = fd == -1 ? NULL : fdopen(fd, "w");
+    if (f == NULL) {
+        if (fd != -1) close(fd);
+    } else {
+        int ok = curl_easy_ssls_export(easy, save_session, f) == CURLE_OK;
+        if (fclose(f) == 0 && ok && rename(tmp, file) == 0) tmp[0] = '\0';
+    }
+    if (fd != -1 && tmp[0]) unlink(tmp);
+    free(tmp);
+}
+#else
+static void load_sessions(CURL *easy, const char *file) { (void)easy, (void)file; }
+static void save_sessions(CURL *easy, const char *file) { (void)easy, (void)file; }
+#endif
+
+int main(int argc, char **argv) {
+    long timeout = 5, jobs = 64, fast = -1, since = -1;
+    int files = 0, list = 0, choose = 0, opt;
+    const char *dir = NULL, *session_file = NULL;
+    while ((opt = getopt(argc, argv, "t:j:f:r:z:Rsmd:lc:Vh")) != -1) {
+        switch (opt) {
+        case 't': timeout = strtol(optarg, NULL, 10); break;
+        case 'j': jobs = strtol(optarg, NULL, 10); break;
+        case 'f':
+            fast = strtol(optarg, NULL, 10);
+            if (fast < 0) usage();
+            break;
+        case 'r': path = optarg; break;
+        case 'z':
+            since = strtol(optarg, NULL, 10);
+            if (since < 0) usage();
+            break;
+        case 'R': rank = 1; break;
+        case 's': choose = 1; break;
+        case 'm': files = 1; break;
+        case 'd': dir = optarg; break;
+        case 'l': list = 1; break;
+        case 'c': session_file = optarg; break;
+        case 'V':
+            printf("termux-mirror-probe (termux-tools %s) %s\n", PACKAGE_VERSION, curl_version());
+            return EXIT_SUCCESS;
+        default: usage();
+        }
+    }
+    if (optind != argc || timeout < 1 || jobs < 1) usage();
+    if (!files && (dir || list)) usage();
+
+    if (files) read_mirror_files(dir);
+    else read_mirror_urls();
+    if (list) {
+        list_mirrors();
+        return EXIT_SUCCESS;
+    }
+    if (nmirrors == 0) return EXIT_SUCCESS;
+
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) errx(EXIT_FAILURE, "curl_global_init");
+    CURLM *multi = curl_multi_init();
+    if (multi == NULL) errx(EXIT_FAILURE, "curl_multi_init");
+    curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, jobs);
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    /* Sessions are imported and exported through a handle of their own,
+       since the ones of the checks come and go. */
+    CURL *sessions = curl_easy_init();
+    CURLSH *share = curl_share_init();
+    if (sessions == NULL || share == NULL) errx(EXIT_FAILURE, "curl_share_init");
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_easy_setopt(sessions, CURLOPT_SHARE, share);
+    if (session_file) load_sessions(sessions, session_file);
+
+    /* Transfers queued behind -j share the same deadline, since libcurl
+       counts CURLOPT_TIMEOUT from the moment a handle is added. */
+    for (size_t i = 0; i < nmirrors; i++) {
+        struct mirror *m = &mirrors[i];
+        if (m->known) continue;
+        m->easy = curl_easy_init();
+        if (m->easy == NULL) errx(EXIT_FAILURE, "curl_easy_init");
+        curl_easy_setopt(m->easy, CURLOPT_URL, m->url);
+        curl_easy_setopt(m->easy, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(m->easy, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(m->easy, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(m->easy, CURLOPT_USERAGENT, USER_AGENT);
+        curl_easy_setopt(m->easy, CURLOPT_CONNECTTIMEOUT, timeout);
+        curl_easy_setopt(m->easy, CURLOPT_TIMEOUT, timeout);
+        curl_easy_setopt(m->easy, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(m->easy, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(m->easy, CURLOPT_PIPEWAIT, 1L);
+        curl_easy_setopt(m->easy, CURLOPT_SHARE, share);
+        curl_easy_setopt(m->easy, CURLOPT_PRIVATE, m);
+        if (since >= 0) {
+            curl_easy_setopt(m->easy, CURLOPT_TIMECONDITION, (long)CURL_TIMECOND_IFMODSINCE);
+            curl_easy_setopt(m->easy, CURLOPT_TIMEVALUE, since);
+        }
+        curl_multi_add_handle(multi, m->easy);
+    }
+
+    int running = 1, found = 0;
+    while (running && !found) {
+        if (curl_multi_perform(multi, &running) != CURLM_OK) break;
+
+        CURLMsg *msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE) continue;
+            struct mirror *m;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&m);
+            long ttfb_ms = report(m, msg->data.result == CURLE_OK);
+            if (fast >= 0 && ttfb_ms >= 0 && ttfb_ms <= fast) found = 1;
+            curl_multi_remove_handle(multi, m->easy);
+            curl_easy_cleanup(m->easy);
+            m->easy = NULL;
+            if (found) break;
+        }
+
+        if (running && !found && curl_multi_poll(multi, NULL, 0, 1000, NULL) != CURLM_OK) break;
+    }
+
+    for (size_t i = 0; i < nmirrors; i++) {
+        struct mirror *m = &mirrors[i];
+        if (m->known || m->result != PENDING) continue;
+        if (!found) report(m, 0);
+        if (m->easy) {
+            curl_multi_remove_handle(multi, m->easy);
+            curl_easy_cleanup(m->easy);
+        }
+    }
+
+    if (rank) print_ranked();
+    if (choose) select_mirror();
+
+    if (session_file) save_sessions(sessions, session_file);
+    curl_easy_cleanup(sessions);
+    curl_multi_cleanup(multi);
+    curl_share_cleanup(share);
+    curl_global_cleanup();
+    return EXIT_SUCCESS;
+}